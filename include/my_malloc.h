@@ -3,9 +3,30 @@
 
 #include <stddef.h> //per size_t
 
+//dimensioni del buddy allocator (in potenze di 2), usate anche dal percorso veloce inline
+#define MY_MALLOC_POOL_LOG2 20 //pool da 1MB
+#define MY_MALLOC_MIN_BLOCK_LOG2 6 //blocchi minimi da 64 byte
+#define MY_MALLOC_NUM_LEVELS (MY_MALLOC_POOL_LOG2 - MY_MALLOC_MIN_BLOCK_LOG2 + 1) //livelli dell'albero buddy
+
+//livello buddy di un blocco di total_size byte (intestazione compresa): potenza di 2 successiva
+//calcolata con __builtin_clzl, costante se total_size è costante
+#define MY_MALLOC_LEVEL_FROM_SIZE(total_size) \
+    ((total_size) <= (1UL << MY_MALLOC_MIN_BLOCK_LOG2) ? (MY_MALLOC_POOL_LOG2 - MY_MALLOC_MIN_BLOCK_LOG2) : \
+     (total_size) >= (1UL << MY_MALLOC_POOL_LOG2) ? 0 : \
+     MY_MALLOC_POOL_LOG2 - (int)(sizeof(unsigned long) * 8 - __builtin_clzl((unsigned long)(total_size) - 1)))
+
+//contatori del buddy allocator
+typedef struct MyMallocStats{
+    size_t splits; //divisioni di un blocco nei due figli
+    size_t merges; //unioni di un blocco con il suo buddy
+    size_t deferred_hits; //allocazioni servite dalla cache della coalescenza differita
+} MyMallocStats;
+
 //dichiarazione delle funzioni pubbliche
 void* my_malloc(size_t size);
 void my_free(void* ptr);
+//come my_malloc, con il livello buddy già calcolato (deve essere MY_MALLOC_LEVEL_FROM_SIZE(size + sizeof(size_t)))
+void* my_malloc_size_class(size_t size, int level);
 void print_large_alloc_list();
 void BuddyAllocator_print_bitmap();
 void BuddyAllocator_print_pool();
@@ -19,5 +40,32 @@ int my_read_large_alloc(void* ptr, size_t offset, void* buffer, size_t buffer_si
 int my_write_buddy_alloc(void* ptr, const char* data, size_t size);
 int my_read_buddy_alloc(void* ptr, char* buffer, size_t size);
 
+//coalescenza differita e statistiche del buddy allocator
+int my_malloc_set_lazy_coalescing(size_t watermark);
+void my_malloc_get_stats(MyMallocStats* stats);
+void my_malloc_reset_stats();
+
+//pre-faulting e preparazione per la fase di avvio
+void my_malloc_set_prefault(int enabled);
+//i blocchi divisi in anticipo restano nella cache della coalescenza differita: per ogni livello se ne
+//possono chiedere al massimo quanti ne permette my_malloc_set_lazy_coalescing (nessuno con la coalescenza
+//immediata, quella predefinita), e solo ai livelli usati da my_malloc; altrimenti restituisce 0 senza fare nulla
+int my_malloc_reserve(size_t bytes, const size_t* per_level_hint);
+
+//funzioni per il heap persistente (snapshot e ripristino a indirizzo fisso)
+int my_heap_persistent_init();
+//durante lo snapshot gli altri thread non devono scrivere nella memoria allocata, altrimenti
+//l'immagine può contenere dati aggiornati solo in parte (resta comunque ripristinabile)
+int my_heap_snapshot(const char* path);
+int my_heap_restore(const char* path);
+
+//percorso veloce: se size è una costante il livello viene calcolato a tempo di compilazione
+//(definire MY_MALLOC_NO_FAST_PATH per disattivarlo)
+#if defined(__GNUC__) && !defined(MY_MALLOC_NO_FAST_PATH)
+#define my_malloc(size) \
+    (__builtin_constant_p(size) ? my_malloc_size_class((size), MY_MALLOC_LEVEL_FROM_SIZE((size) + sizeof(size_t))) \
+                                : (my_malloc)(size))
+#endif
+
 #endif //MY_MALLOC_H
 
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE //per mremap con MREMAP_FIXED
+
 #include "../include/my_malloc.h"
+#undef my_malloc //la definizione di my_malloc non passa dal percorso veloce del header
 
 #include <unistd.h> //per sysconf
 #include <sys/mman.h> // per mmap e munmap
@@ -8,6 +11,10 @@
 #include <math.h> //per log2
 #include <string.h> //per memset
 #include <stdlib.h> //per malloc
+#include <stdint.h> //per uint64_t e uintptr_t
+#include <stddef.h> //per offsetof
+#include <fcntl.h> //per open
+#include <sys/stat.h> //per fstat
 
 // inizializzazione variabili globali
 static size_t PAGE_SIZE = 0; //dimensione della pagina di memoria (0 inizialmente per lazy init)
@@ -15,8 +22,37 @@ static size_t MALLOC_TRESHOLD = 0; // soglia per decidere tra mmap e buddy alloc
 
 static pthread_mutex_t my_malloc_mutex = PTHREAD_MUTEX_INITIALIZER; // mutex globale per thread-safety
 
-//dichiarazione inizializzazione buddy allocator
+static int prefault_enabled = 0; // se 1 le nuove mappature vengono popolate subito (niente page fault al primo accesso)
+
+//dichiarazione inizializzazione buddy allocator e del puntatore al suo pool
 static void BuddyAllocator_init();
+static char* buddy_pool_start;
+
+//calcola la dimensione della pagina e la soglia (da chiamare con il mutex bloccato)
+static void init_page_size(){
+    PAGE_SIZE = sysconf(_SC_PAGESIZE); //dimensione pagina di sistema
+    MALLOC_TRESHOLD = PAGE_SIZE/4; //calcolo della soglia
+    printf("PAGE_SIZE: %zu, MALLOC_TRESHOLD: %zu\n", PAGE_SIZE, MALLOC_TRESHOLD);
+}
+
+//arrotonda una dimensione al multiplo di pagina successivo
+static size_t round_up_to_page(size_t size){
+    return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+//porta in memoria le pagine di [addr, addr + len) (addr allineato alla pagina), così il primo accesso
+//non causa un page fault
+static void prefault_range(void* addr, size_t len){
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0){
+        return;
+    }
+#endif
+    //kernel senza MADV_POPULATE_WRITE: tocco un byte per pagina senza cambiarne il valore
+    for (size_t offset = 0; offset < len; offset += PAGE_SIZE){
+        __atomic_fetch_or((char*)addr + offset, 0, __ATOMIC_RELAXED);
+    }
+}
 
 // funzione inizializzazione del sistema di allocazione
 static void init_mallloc_system(){
@@ -25,10 +61,11 @@ static void init_mallloc_system(){
     pthread_mutex_lock(&my_malloc_mutex);
 
     if (PAGE_SIZE == 0){
-        PAGE_SIZE = sysconf(_SC_PAGESIZE); //dimensione pagina di sistema
-        MALLOC_TRESHOLD = PAGE_SIZE/4; //calcolo della soglia
-        printf("PAGE_SIZE: %zu, MALLOC_TRESHOLD: %zu\n", PAGE_SIZE, MALLOC_TRESHOLD);
-
+        init_page_size();
+    }
+    //il pool può mancare anche con PAGE_SIZE già calcolata, se l'attivazione o il ripristino
+    //del heap persistente sono falliti prima della prima allocazione
+    if (buddy_pool_start == NULL){
         BuddyAllocator_init();
     }
     //sblocco il mutex
@@ -43,15 +80,29 @@ typedef struct LargeAllocInfo{
     struct LargeAllocInfo* next; //puntatore al prossimo elemento della lista
 } LargeAllocInfo;
 
-//puntatore alla testa della lista delle allocazioni grandi (inizialmente vuota)
-static LargeAllocInfo* large_allocs_head = NULL;
+//testa della lista delle allocazioni grandi (inizialmente vuota)
+static LargeAllocInfo* default_large_allocs_head = NULL;
+//puntatore alla testa in uso: punta dentro la regione persistente se il heap persistente è attivo
+static LargeAllocInfo** large_allocs_head = &default_large_allocs_head;
+
+//inizio della regione persistente (NULL se il heap persistente non è attivo)
+static char* persistent_heap_base = NULL;
+
+//dichiarazioni delle funzioni del heap persistente usate dalle allocazioni grandi
+static void* PersistentHeap_add_large_alloc(size_t size);
+static void PersistentHeap_release_large_alloc(LargeAllocInfo* node);
 
 // funzione che aggiunge un'allocazione grande alla lista
 static void* add_large_alloc(size_t size){
 
+    //con il heap persistente i blocchi vengono presi dall'area dedicata della regione
+    if (persistent_heap_base != NULL){
+        return PersistentHeap_add_large_alloc(size);
+    }
+
     //void* ptr = NULL;
     //alloca la struttura usando mmap
-    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    void* ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|(prefault_enabled ? MAP_POPULATE : 0), -1, 0);
     if (ptr == MAP_FAILED){
         perror("Errore: fallita l'allocazione del blocco di memoria\n");
         return NULL;
@@ -68,15 +119,15 @@ static void* add_large_alloc(size_t size){
         new_node->size = size;
 
         //il nuovo nodo si trova all'inizio della lista
-        new_node->next = large_allocs_head;
-        large_allocs_head = new_node;
+        new_node->next = *large_allocs_head;
+        *large_allocs_head = new_node;
     }
     return ptr;
 }
 
 //funzione per la rimozione di un'allocazione grande dalla lista
 static int remove_large_alloc(void* ptr){
-    LargeAllocInfo* current = large_allocs_head;
+    LargeAllocInfo* current = *large_allocs_head;
     LargeAllocInfo* prev = NULL;
 
     //ciclo che scorre la lista per trovare il nodo corrispondente a ptr
@@ -93,11 +144,17 @@ static int remove_large_alloc(void* ptr){
     //caso in cui il puntatore sia stato trovato
     if (prev == NULL){
         //il nodo è in testa alla lista
-        large_allocs_head = current->next;
+        *large_allocs_head = current->next;
     } else {
         //il nodo è in mezzo o a fine lista
         prev->next = current->next;
     }
+
+    if (persistent_heap_base != NULL){
+        PersistentHeap_release_large_alloc(current);
+        return 1;
+    }
+
     size_t out_size = current->size;
     
     if (munmap(current->ptr, out_size) == -1){
@@ -111,11 +168,12 @@ static int remove_large_alloc(void* ptr){
 
 //ALLOCAZIONI CON BUDDY ALLOCATOR
 //definizioni costanti
-#define BUDDY_POOL_SIZE (1024*1024) //dimensione totale del pool gestito dal buddy (1MB)
-#define MIN_BLOCK_SIZE 64 //dimensione minima allocabile dal buddy
+#define BUDDY_POOL_SIZE (1 << MY_MALLOC_POOL_LOG2) //dimensione totale del pool gestito dal buddy (1MB)
+#define MIN_BLOCK_SIZE (1 << MY_MALLOC_MIN_BLOCK_LOG2) //dimensione minima allocabile dal buddy
 
 //definizione del numero di livelli nell'albero (livello 0: 1MB, livello MAX_LEVEL - 1: blocchi da MIN_BLOCK_SIZE)
 #define MAX_LEVEL 14 //(int)(log2(BUDDY_POOL_SIZE) - log2(MIN_BLOCK_SIZE))
+_Static_assert(MAX_LEVEL == MY_MALLOC_POOL_LOG2 - MY_MALLOC_MIN_BLOCK_LOG2, "MAX_LEVEL non coerente con il pool");
 
 //definizione numero di nodi nell'albero binario (2^(MAX_LEVEL+1) - 1)
 #define TOTAL_NODES ((1 << (MAX_LEVEL + 1)) - 1)
@@ -125,7 +183,8 @@ static int remove_large_alloc(void* ptr){
 
 static char* buddy_pool_start = NULL; //puntatore all'inizio del pool di memoria gestito dal buddy
 
-static unsigned char buddy_bitmap[BITMAP_SIZE_BYTES]; //bitmap che contiene i bit che indicano lo stato dei bloccchi
+static unsigned char default_buddy_bitmap[BITMAP_SIZE_BYTES]; //bitmap che contiene i bit che indicano lo stato dei bloccchi
+static unsigned char* buddy_bitmap = default_buddy_bitmap; //bitmap in uso (dentro la regione persistente se attiva)
 
 //macro per la gestione dei bit della bitmap
 #define GET_BYTE(idx) (buddy_bitmap[(idx) / 8]) //prende il byte in cui si trova il bit all'idx
@@ -142,6 +201,25 @@ static unsigned char buddy_bitmap[BITMAP_SIZE_BYTES]; //bitmap che contiene i bi
 
 #define BUDDY(idx) (((idx) % 2 == 0) ? ((idx) - 1) : ((idx) + 1)) //indice del buddy di un nodo (se è sinistro restituisce il destro, altrimenti il sinistro)
 
+//un blocco è libero se il suo bit è 0 e il genitore è diviso. Un genitore diviso ha il bit a 1 e almeno
+//un figlio a 1 (altrimenti i due figli sarebbero stati uniti): dato che idx è a 0, il buddy deve essere a 1.
+//Così i figli di un blocco occupato o nella cache della coalescenza differita (bit a 1, figli a 0) non
+//vengono mai considerati liberi.
+#define IS_FREE_BLOCK(idx) (!IS_BIT_SET(idx) && ((idx) == 0 || (IS_BIT_SET(PARENT(idx)) && IS_BIT_SET(BUDDY(idx)))))
+
+//COALESCENZA DIFFERITA
+//Con la coalescenza differita i blocchi liberati restano al loro livello (con il bit ancora a 1) in una
+//cache per livello, fino a lazy_watermark blocchi. Una malloc dello stesso livello li riusa senza
+//dividere e senza toccare la bitmap. La cache viene svuotata (con l'unione dei buddy) quando una
+//richiesta non può essere soddisfatta; i blocchi oltre la soglia vengono uniti subito.
+#define MAX_DEFERRED_PER_LEVEL 64 //capacità massima della cache di ogni livello
+
+static size_t lazy_watermark = 0; //soglia per livello (0: coalescenza immediata)
+static int deferred_blocks[MAX_LEVEL + 1][MAX_DEFERRED_PER_LEVEL]; //indici dei blocchi in cache per livello
+static size_t deferred_count[MAX_LEVEL + 1]; //numero di blocchi in cache per livello
+
+static MyMallocStats buddy_stats; //contatori di divisioni, unioni e riusi dalla cache
+
 //funzioni èer conversioni buddy
 
 //calcola la dimensione del blocco di memoria corrispondente a un dato livello
@@ -150,30 +228,9 @@ static size_t get_block_size_from_level(int level){
 }
 
 //calcola il livello in cui si trova un blocco di una certa dimensione
+//(la minima potenza di 2 maggiore o uguale a size, limitata tra MIN_BLOCK_SIZE e BUDDY_POOL_SIZE)
 static int get_level_from_size(size_t size){
-    if (size < MIN_BLOCK_SIZE){
-        size = MIN_BLOCK_SIZE;
-    }
-
-    //trova la minima potenza di 2 maggiore o uguale a size
-    size_t actual_size = 1;
-    while(actual_size < size){
-        actual_size <<= 1;
-    }
-
-    //limita la dimensione al massimo del pool
-    if (actual_size > BUDDY_POOL_SIZE){
-        actual_size = BUDDY_POOL_SIZE;
-    }
-
-    //calcola il livello
-    int level = 0;
-    size_t temp_size = BUDDY_POOL_SIZE;
-    while (temp_size > actual_size && level < MAX_LEVEL){
-        temp_size >>= 1;
-        level++;
-    }
-    return level;
+    return MY_MALLOC_LEVEL_FROM_SIZE(size);
 }
 
 //calcola l'offset all'interno di buddy_pool_start
@@ -198,7 +255,8 @@ static int get_idx_from_offset_and_level(size_t offset, int level){
 //inizializzazione del buddy allocator
 static void BuddyAllocator_init(){
     //alloca 1MB di memoria per il pool del buddy allocator usando mmap
-    buddy_pool_start = (char*)mmap(NULL, BUDDY_POOL_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    buddy_pool_start = (char*)mmap(NULL, BUDDY_POOL_SIZE, PROT_READ|PROT_WRITE,
+                                   MAP_PRIVATE|MAP_ANONYMOUS|(prefault_enabled ? MAP_POPULATE : 0), -1, 0);
     //printf("pool inizializzato a %p\n", buddy_pool_start);
     if(buddy_pool_start == MAP_FAILED){
         perror("Errore: fallita l'allocazione del pool del buddy allocator");
@@ -210,24 +268,18 @@ static void BuddyAllocator_init(){
     //printf("buddy allocator: pool inizializzato a %p, dimensione %u byte. Bitmap di %zu byte\n", buddy_pool_start, BUDDY_POOL_SIZE, BITMAP_SIZE_BYTES);
 }
 
-//funzione che alloca un blocco di memoria dal pool del buddy allocator
-static void* BuddyAllocator_malloc(size_t size){
-    //alloco uno spazio all'inizio del blocco per memorizzare la sua dimensione
-    size_t required_size_with_header = size + sizeof(size_t);
-
-    //controllo se la richiesta è troppo grande
-    if (required_size_with_header > BUDDY_POOL_SIZE){
-        return NULL;
-    }
-
-    //determino il livello dell'albero buddy che può ospitare la dimensione richiesta
-    int target_level = get_level_from_size(required_size_with_header);
+//dichiarazione della funzione che svuota la cache della coalescenza differita
+static size_t BuddyAllocator_flush_deferred();
 
+//cerca un blocco libero abbastanza grande, lo divide fino a target_level e lo segna come occupato
+//restituisce l'indice del blocco al livello target, o -1 se il pool non ha spazio
+static int BuddyAllocator_take_block(int target_level){
     int found_idx = -1;
     int actual_level = -1;
 
     //scorre i livelli dell'albero dal più grande al livello target
-    for (int current_level = 0; current_level <= MAX_LEVEL; ++current_level){
+    //(i blocchi dei livelli più profondi sono troppo piccoli)
+    for (int current_level = 0; current_level <= target_level; ++current_level){
         //calcola l'indice di partenza e il numero di nodi per il livello corrente
         size_t level_start_idx = (1 << current_level) - 1;
         size_t num_nodes_at_level = (1 << current_level);
@@ -235,22 +287,18 @@ static void* BuddyAllocator_malloc(size_t size){
         for (size_t i = 0; i < num_nodes_at_level; ++i){
             int idx = level_start_idx + i;
             
-            //se il bit non è impostato il blocco è libero
-            if (!IS_BIT_SET(idx)){
-                //controllo se la dimensione del blocco è sufficiente
-                if (get_block_size_from_level(current_level) >= required_size_with_header){
-                    found_idx = idx; //trovato un blocco adatto
-                    actual_level = current_level; //registro il livello
-
-                    goto found_block; //esco dal ciclo una volta trovato
-                }
+            //il blocco deve essere libero e non dentro un blocco occupato o in cache
+            if (IS_FREE_BLOCK(idx)){
+                found_idx = idx; //trovato un blocco adatto
+                actual_level = current_level; //registro il livello
+
+                goto found_block; //esco dal ciclo una volta trovato
             }
         }
     }
     found_block:
-    //se non è stato trovato un blocco adatto, restituisco null
         if (found_idx == -1){
-            return NULL;
+            return -1;
         }
         //se il blocco è troppo grande, viene diviso ricorsivamente fino alla dimensione necessaria
         while(actual_level < target_level){
@@ -259,32 +307,54 @@ static void* BuddyAllocator_malloc(size_t size){
             //passa al figlio sinistro
             found_idx = LEFT_CHILD(found_idx);
             actual_level++; //scendo di livello
+            buddy_stats.splits++;
         }
 
         //indico il blocco come occupato
         SET_BIT(found_idx);
-        //calcolo l'indirizzo di memoria all'interno del pool
-        char* actual_block_start = buddy_pool_start + get_offset_from_idx_and_level(found_idx, actual_level);
-        //memorizzo la dimensione allocata (scrivo dentro il blocco per occuparlo)
-        *(size_t*) actual_block_start = required_size_with_header;
-        //restituisco il puntatore(dopo l'intestazione)
-        return (void*)(actual_block_start + sizeof(size_t));
+        return found_idx;
 }
 
-//implementazione del buddy_free
-//libera un blocco di memoria precedentemente allocato dal pool del buddy allocator
-static void BuddyAllocator_free(void* ptr){
-    //puntatore all'inizio del blocco allocato
-    char* original_alloc_ptr = (char*)ptr - sizeof(size_t);
-    //dimensione originale del blocco (inclusa intestazione)
-    size_t allocated_size = *(size_t*) original_alloc_ptr;
-    //calcolo l'offset del blocco all'interno del pool di memoria
-    size_t offset = (size_t)(original_alloc_ptr - buddy_pool_start);
-    //livello originale del blocco in base alla dimensione
-    int level = get_level_from_size(allocated_size);
-    //indice del nodo corrispondente nella bitmap
-    int idx = get_idx_from_offset_and_level(offset, level);
+//funzione che alloca un blocco di memoria dal pool del buddy allocator
+//target_level è il livello dell'albero buddy che può ospitare la dimensione richiesta
+static void* BuddyAllocator_malloc(size_t size, int target_level){
+    //alloco uno spazio all'inizio del blocco per memorizzare la sua dimensione
+    size_t required_size_with_header = size + sizeof(size_t);
+
+    //controllo se la richiesta è troppo grande
+    if (required_size_with_header > BUDDY_POOL_SIZE){
+        return NULL;
+    }
 
+    //se c'è un blocco in cache a questo livello lo riuso: il suo bit è già a 1
+    if (deferred_count[target_level] > 0){
+        int cached_idx = deferred_blocks[target_level][--deferred_count[target_level]];
+        char* cached_block_start = buddy_pool_start + get_offset_from_idx_and_level(cached_idx, target_level);
+        *(size_t*) cached_block_start = required_size_with_header;
+        buddy_stats.deferred_hits++;
+        return (void*)(cached_block_start + sizeof(size_t));
+    }
+
+    int found_idx = BuddyAllocator_take_block(target_level);
+
+    //se non è stato trovato un blocco adatto, svuoto la cache e riprovo, altrimenti restituisco null
+    if (found_idx == -1){
+        if (BuddyAllocator_flush_deferred() > 0){
+            return BuddyAllocator_malloc(size, target_level);
+        }
+        return NULL;
+    }
+
+    //calcolo l'indirizzo di memoria all'interno del pool
+    char* actual_block_start = buddy_pool_start + get_offset_from_idx_and_level(found_idx, target_level);
+    //memorizzo la dimensione allocata (scrivo dentro il blocco per occuparlo)
+    *(size_t*) actual_block_start = required_size_with_header;
+    //restituisco il puntatore(dopo l'intestazione)
+    return (void*)(actual_block_start + sizeof(size_t));
+}
+
+//libera il blocco idx al livello level e lo unisce con i buddy liberi risalendo l'albero
+static void BuddyAllocator_release(int idx, int level){
     CLEAR_BIT(idx); //libero il blocco, imposto bit a 0
     
     //ciclo che tenta di unire il blocco liberato con il suo buddy
@@ -308,11 +378,53 @@ static void BuddyAllocator_free(void* ptr){
         CLEAR_BIT(idx); // anche il genitore diventa libero
 
         level--;
+        buddy_stats.merges++;
+    }
+}
+
+//libera tutti i blocchi nella cache della coalescenza differita, unendoli con i loro buddy
+//restituisce il numero di blocchi liberati
+static size_t BuddyAllocator_flush_deferred(){
+    size_t flushed = 0;
+    for (int level = 0; level <= MAX_LEVEL; ++level){
+        while (deferred_count[level] > 0){
+            BuddyAllocator_release(deferred_blocks[level][--deferred_count[level]], level);
+            flushed++;
+        }
+    }
+    return flushed;
+}
+
+//implementazione del buddy_free
+//libera un blocco di memoria precedentemente allocato dal pool del buddy allocator
+static void BuddyAllocator_free(void* ptr){
+    //puntatore all'inizio del blocco allocato
+    char* original_alloc_ptr = (char*)ptr - sizeof(size_t);
+    //dimensione originale del blocco (inclusa intestazione)
+    size_t allocated_size = *(size_t*) original_alloc_ptr;
+    //calcolo l'offset del blocco all'interno del pool di memoria
+    size_t offset = (size_t)(original_alloc_ptr - buddy_pool_start);
+    //livello originale del blocco in base alla dimensione
+    int level = get_level_from_size(allocated_size);
+    //indice del nodo corrispondente nella bitmap
+    int idx = get_idx_from_offset_and_level(offset, level);
+
+    //con la coalescenza differita il blocco resta occupato nella cache, finché c'è posto
+    if (deferred_count[level] < lazy_watermark){
+        deferred_blocks[level][deferred_count[level]++] = idx;
+        return;
     }
+
+    BuddyAllocator_release(idx, level);
 }
 
 //implementazione della mia versione di malloc
 void* my_malloc(size_t size){
+    return my_malloc_size_class(size, get_level_from_size(size + sizeof(size_t)));
+}
+
+//malloc con il livello buddy già calcolato (dal percorso veloce del header per le dimensioni costanti)
+void* my_malloc_size_class(size_t size, int level){
 
     init_mallloc_system(); //controllo se il sistema è inizializzato
 
@@ -321,6 +433,15 @@ void* my_malloc(size_t size){
         return NULL;
     }
 
+    //il livello deve essere esattamente quello della dimensione, altrimenti la free troverebbe un altro blocco
+    size_t required_size_with_header = size + sizeof(size_t);
+    if (size < MALLOC_TRESHOLD && (level < 0 || level > MAX_LEVEL ||
+        get_block_size_from_level(level) < required_size_with_header ||
+        (level < MAX_LEVEL && get_block_size_from_level(level + 1) >= required_size_with_header))){
+        fprintf(stderr, "Errore: livello %d non valido per la dimensione %zu\n", level, size);
+        return NULL;
+    }
+
     pthread_mutex_lock(&my_malloc_mutex); //blocco il mutex
 
     void* ptr = NULL; //definizione puntatore che deve restituire la funzione
@@ -329,7 +450,7 @@ void* my_malloc(size_t size){
     if (size >= MALLOC_TRESHOLD){
         ptr = add_large_alloc(size);
     } else {
-        ptr = BuddyAllocator_malloc(size);
+        ptr = BuddyAllocator_malloc(size, level);
         if (ptr == NULL){
             fprintf(stderr, "Errore: non è stato possibile usare il buddy allocator\n");
         }
@@ -369,9 +490,121 @@ void my_free(void* ptr){
     pthread_mutex_unlock(&my_malloc_mutex); //sblocco il mutex
 }
 
+//imposta la soglia per livello della coalescenza differita (0: coalescenza immediata)
+//restituisce 0 se la soglia supera la capacità della cache
+int my_malloc_set_lazy_coalescing(size_t watermark){
+    if (watermark > MAX_DEFERRED_PER_LEVEL){
+        fprintf(stderr, "Errore: soglia massima della coalescenza differita: %d\n", MAX_DEFERRED_PER_LEVEL);
+        return 0;
+    }
+
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    lazy_watermark = watermark;
+    //i blocchi oltre la nuova soglia vengono uniti subito
+    for (int level = 0; level <= MAX_LEVEL; ++level){
+        while (deferred_count[level] > lazy_watermark){
+            BuddyAllocator_release(deferred_blocks[level][--deferred_count[level]], level);
+        }
+    }
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+    return 1;
+}
+
+//attiva o disattiva il pre-faulting delle nuove mappature (pool e allocazioni grandi)
+//se il pool esiste già e il pre-faulting viene attivato, il pool viene popolato subito
+void my_malloc_set_prefault(int enabled){
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    prefault_enabled = enabled;
+    if (prefault_enabled && buddy_pool_start != NULL){
+        prefault_range(buddy_pool_start, BUDDY_POOL_SIZE);
+    }
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+}
+
+//prepara l'allocatore per la fase di avvio: popola i primi bytes del pool e divide in anticipo
+//per_level_hint[level] blocchi per ogni livello (array di MY_MALLOC_NUM_LEVELS elementi, può essere NULL).
+//I blocchi divisi restano nella cache della coalescenza differita e vengono usati dalle prime malloc
+//di quel livello, quindi per ogni livello se ne possono riservare al massimo lazy_watermark (nessuno con
+//la coalescenza immediata), e solo ai livelli usati da my_malloc (blocchi per dimensioni sotto la soglia).
+//Se i suggerimenti non sono validi non viene fatto nulla. Restituisce 0 se non è stato possibile riservare tutto.
+int my_malloc_reserve(size_t bytes, const size_t* per_level_hint){
+    init_mallloc_system(); //controllo che il sistema sia inizializzato
+
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    if (buddy_pool_start == NULL){
+        fprintf(stderr, "Errore: pool del buddy allocator non disponibile\n");
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    //i blocchi più grandi di quelli per MALLOC_TRESHOLD - 1 byte non verrebbero mai usati: quelle richieste vanno a mmap
+    int min_level = get_level_from_size(MALLOC_TRESHOLD - 1 + sizeof(size_t));
+    for (int level = 0; per_level_hint != NULL && level <= MAX_LEVEL; ++level){
+        if (per_level_hint[level] == 0){
+            continue;
+        }
+        if (level < min_level){
+            fprintf(stderr, "Errore: il livello %d ha blocchi troppo grandi per my_malloc\n", level);
+            pthread_mutex_unlock(&my_malloc_mutex);
+            return 0;
+        }
+        if (deferred_count[level] + per_level_hint[level] > lazy_watermark){
+            fprintf(stderr, "Errore: al massimo %zu blocchi in cache per livello (soglia della coalescenza differita)\n", lazy_watermark);
+            pthread_mutex_unlock(&my_malloc_mutex);
+            return 0;
+        }
+    }
+
+    //il buddy allocator usa prima i blocchi con offset più basso, quindi si popola l'inizio del pool
+    if (bytes > BUDDY_POOL_SIZE){
+        bytes = BUDDY_POOL_SIZE;
+    }
+    if (bytes > 0){
+        prefault_range(buddy_pool_start, round_up_to_page(bytes));
+    }
+
+    int reserved_all = 1;
+    for (int level = 0; per_level_hint != NULL && level <= MAX_LEVEL; ++level){
+        for (size_t i = 0; i < per_level_hint[level]; ++i){
+            int idx = BuddyAllocator_take_block(level);
+            if (idx == -1){
+                fprintf(stderr, "Errore: spazio insufficiente nel pool per i blocchi richiesti\n");
+                reserved_all = 0;
+                break;
+            }
+            deferred_blocks[level][deferred_count[level]++] = idx;
+        }
+    }
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+    return reserved_all;
+}
+
+//copia in stats i contatori del buddy allocator
+void my_malloc_get_stats(MyMallocStats* stats){
+    if (stats == NULL){
+        return;
+    }
+    pthread_mutex_lock(&my_malloc_mutex);
+    *stats = buddy_stats;
+    pthread_mutex_unlock(&my_malloc_mutex);
+}
+
+//azzera i contatori del buddy allocator
+void my_malloc_reset_stats(){
+    pthread_mutex_lock(&my_malloc_mutex);
+    memset(&buddy_stats, 0, sizeof(buddy_stats));
+    pthread_mutex_unlock(&my_malloc_mutex);
+}
+
 //funzione di debug per stampare la lista delle allocazioni grandi
 void print_large_alloc_list(){
-    LargeAllocInfo* current = large_allocs_head;
+    LargeAllocInfo* current = *large_allocs_head;
     printf("Stato della lista di allocazioni grandi:\n");
 
     if(!current){
@@ -447,7 +680,7 @@ void dump_pool(size_t num_bytes){
 
 //funzione che trova l'allocazione grande
 static LargeAllocInfo* find_large_alloc(void* ptr){
-    LargeAllocInfo* current = large_allocs_head;
+    LargeAllocInfo* current = *large_allocs_head;
     while(current != NULL){
         if (current->ptr == ptr){
             return current;
@@ -558,3 +791,502 @@ int my_read_buddy_alloc(void* ptr, char* buffer, size_t size){
     return 1;
 }
 
+
+
+//HEAP PERSISTENTE (snapshot e ripristino)
+//In modalità persistente il pool del buddy allocator e le allocazioni grandi vivono in un'unica regione
+//mappata sempre allo stesso indirizzo. Anche i metadati (bitmap e lista delle allocazioni grandi) sono
+//dentro la regione, quindi un'immagine salvata su file può essere rimappata da un altro processo
+//con tutti i puntatori ancora validi.
+//Struttura della regione: [intestazione + metadati][pool del buddy][area allocazioni grandi]
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0 //kernel vecchi: l'indirizzo viene usato come suggerimento e poi controllato
+#endif
+
+#define PERSISTENT_HEAP_BASE ((char*)0x200000000000UL) //indirizzo fisso della regione persistente
+#define PERSISTENT_HEAP_MAGIC 0x50534d414c4c4f43ULL //"PSMALLOC"
+#define PERSISTENT_HEAP_VERSION 1
+#define PERSISTENT_LARGE_ARENA_SIZE (64UL*1024*1024) //spazio riservato alle allocazioni grandi (64MB)
+#define PERSISTENT_MAX_LARGE_ALLOCS 1024 //numero massimo di allocazioni grandi contemporanee
+
+//intestazione all'inizio della regione persistente
+typedef struct PersistentHeapHeader{
+    uint64_t magic; //identifica un'immagine valida
+    uint64_t checksum; //checksum dell'immagine (calcolato con questo campo a zero)
+    uint32_t version;
+    uint32_t bitmap_size; //dimensione della bitmap, per rifiutare immagini di configurazioni diverse
+    uintptr_t base_addr; //indirizzo a cui la regione deve essere mappata
+    size_t header_size; //dimensione dell'intestazione arrotondata alla pagina
+    size_t pool_size;
+    size_t large_arena_size;
+    size_t max_large_allocs;
+    size_t image_size; //byte significativi della regione (scritti nello snapshot)
+    LargeAllocInfo* large_allocs_head; //testa della lista delle allocazioni grandi
+    unsigned char buddy_bitmap[BITMAP_SIZE_BYTES];
+    LargeAllocInfo large_nodes[PERSISTENT_MAX_LARGE_ALLOCS]; //nodi della lista (ptr == NULL se liberi)
+} PersistentHeapHeader;
+
+static size_t PersistentHeap_header_size(){
+    return round_up_to_page(sizeof(PersistentHeapHeader));
+}
+
+static size_t PersistentHeap_region_size(){
+    return PersistentHeap_header_size() + BUDDY_POOL_SIZE + PERSISTENT_LARGE_ARENA_SIZE;
+}
+
+static PersistentHeapHeader* PersistentHeap_header(){
+    return (PersistentHeapHeader*)persistent_heap_base;
+}
+
+//inizio dell'area delle allocazioni grandi
+static char* PersistentHeap_arena_start(){
+    return persistent_heap_base + PersistentHeap_header_size() + BUDDY_POOL_SIZE;
+}
+
+#define PERSISTENT_CHECKSUM_SEED 0xcbf29ce484222325ULL //valore iniziale del checksum FNV-1a a 64 bit
+#define PERSISTENT_SNAPSHOT_CHUNK (64*1024) //byte copiati e scritti per volta durante lo snapshot
+
+//aggiorna il checksum FNV-1a con len byte che nell'immagine si trovano a partire da offset,
+//saltando il campo checksum
+static uint64_t PersistentHeap_checksum_update(uint64_t hash, const unsigned char* data, size_t len, size_t offset){
+    size_t skip_start = offsetof(PersistentHeapHeader, checksum);
+    size_t skip_end = skip_start + sizeof(uint64_t);
+
+    for (size_t i = 0; i < len; ++i){
+        if (offset + i >= skip_start && offset + i < skip_end){
+            continue;
+        }
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+//checksum dell'intera immagine
+static uint64_t PersistentHeap_checksum(const unsigned char* image, size_t image_size){
+    return PersistentHeap_checksum_update(PERSISTENT_CHECKSUM_SEED, image, image_size, 0);
+}
+
+//riserva la regione persistente all'indirizzo fisso (mutex bloccato)
+static int PersistentHeap_map_region(){
+    size_t region_size = PersistentHeap_region_size();
+    char* region = (char*)mmap(PERSISTENT_HEAP_BASE, region_size, PROT_READ|PROT_WRITE,
+                               MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED_NOREPLACE, -1, 0);
+    if (region == MAP_FAILED){
+        perror("Errore: fallita la mappatura della regione persistente");
+        return 0;
+    }
+    if (region != PERSISTENT_HEAP_BASE){
+        fprintf(stderr, "Errore: la regione persistente non è disponibile all'indirizzo %p\n", (void*)PERSISTENT_HEAP_BASE);
+        munmap(region, region_size);
+        return 0;
+    }
+    return 1;
+}
+
+//collega bitmap, lista e pool alla regione persistente (mutex bloccato)
+static void PersistentHeap_attach(){
+    persistent_heap_base = PERSISTENT_HEAP_BASE;
+    PersistentHeapHeader* header = PersistentHeap_header();
+
+    buddy_bitmap = header->buddy_bitmap;
+    large_allocs_head = &header->large_allocs_head;
+    buddy_pool_start = persistent_heap_base + PersistentHeap_header_size();
+}
+
+//crea la regione persistente al posto del pool normale (mutex bloccato)
+//il pool normale viene rilasciato solo se non ci sono allocazioni attive
+static int PersistentHeap_create_region(){
+    if (PAGE_SIZE == 0){
+        init_page_size();
+    }
+    //i blocchi nella cache della coalescenza differita non sono allocazioni attive
+    BuddyAllocator_flush_deferred();
+    if (buddy_pool_start != NULL && (default_large_allocs_head != NULL || IS_BIT_SET(0))){
+        fprintf(stderr, "Errore: impossibile attivare il heap persistente con allocazioni attive\n");
+        return 0;
+    }
+    if (!PersistentHeap_map_region()){
+        return 0;
+    }
+    if (buddy_pool_start != NULL){
+        munmap(buddy_pool_start, BUDDY_POOL_SIZE);
+        buddy_pool_start = NULL;
+    }
+    return 1;
+}
+
+//attiva il heap persistente con una regione vuota
+int my_heap_persistent_init(){
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    if (persistent_heap_base != NULL){
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 1;
+    }
+    if (!PersistentHeap_create_region()){
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    //la regione è appena mappata, quindi già azzerata: bitmap libera e lista vuota
+    PersistentHeapHeader* header = (PersistentHeapHeader*)PERSISTENT_HEAP_BASE;
+    header->magic = PERSISTENT_HEAP_MAGIC;
+    header->version = PERSISTENT_HEAP_VERSION;
+    header->bitmap_size = BITMAP_SIZE_BYTES;
+    header->base_addr = (uintptr_t)PERSISTENT_HEAP_BASE;
+    header->header_size = PersistentHeap_header_size();
+    header->pool_size = BUDDY_POOL_SIZE;
+    header->large_arena_size = PERSISTENT_LARGE_ARENA_SIZE;
+    header->max_large_allocs = PERSISTENT_MAX_LARGE_ALLOCS;
+
+    PersistentHeap_attach();
+
+    //la regione è riservata con MAP_NORESERVE, quindi viene popolato solo il pool
+    if (prefault_enabled){
+        prefault_range(buddy_pool_start, BUDDY_POOL_SIZE);
+    }
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+    return 1;
+}
+
+//alloca un blocco grande dall'area della regione persistente (mutex bloccato)
+//la lista è mantenuta ordinata per indirizzo, così si può cercare il primo spazio libero sufficiente
+static void* PersistentHeap_add_large_alloc(size_t size){
+    PersistentHeapHeader* header = PersistentHeap_header();
+    size_t rounded_size = round_up_to_page(size);
+
+    //cerca un nodo libero
+    LargeAllocInfo* new_node = NULL;
+    for (size_t i = 0; i < PERSISTENT_MAX_LARGE_ALLOCS; ++i){
+        if (header->large_nodes[i].ptr == NULL){
+            new_node = &header->large_nodes[i];
+            break;
+        }
+    }
+    if (new_node == NULL){
+        fprintf(stderr, "Errore: raggiunto il numero massimo di allocazioni grandi persistenti\n");
+        return NULL;
+    }
+
+    //cerca il primo spazio libero abbastanza grande tra i blocchi già allocati
+    char* candidate = PersistentHeap_arena_start();
+    char* arena_end = candidate + PERSISTENT_LARGE_ARENA_SIZE;
+    LargeAllocInfo* prev = NULL;
+    LargeAllocInfo* current = header->large_allocs_head;
+    while (current != NULL && (size_t)((char*)current->ptr - candidate) < rounded_size){
+        candidate = (char*)current->ptr + round_up_to_page(current->size);
+        prev = current;
+        current = current->next;
+    }
+    if ((size_t)(arena_end - candidate) < rounded_size){
+        fprintf(stderr, "Errore: area delle allocazioni grandi persistenti esaurita\n");
+        return NULL;
+    }
+
+    if (prefault_enabled){
+        prefault_range(candidate, rounded_size);
+    }
+
+    new_node->ptr = candidate;
+    new_node->size = size;
+    new_node->next = current;
+    if (prev == NULL){
+        header->large_allocs_head = new_node;
+    } else {
+        prev->next = new_node;
+    }
+    return candidate;
+}
+
+//restituisce al sistema le pagine di un blocco grande già tolto dalla lista (mutex bloccato)
+static void PersistentHeap_release_large_alloc(LargeAllocInfo* node){
+    if (madvise(node->ptr, round_up_to_page(node->size), MADV_DONTNEED) == -1){
+        perror("Errore: fallito il rilascio delle pagine del blocco\n");
+    }
+    node->ptr = NULL;
+    node->size = 0;
+    node->next = NULL;
+}
+
+//scrive tutti i len byte di data nel file fd
+static int write_all(int fd, const unsigned char* data, size_t len){
+    size_t written = 0;
+    while (written < len){
+        ssize_t ret = write(fd, data + written, len - written);
+        if (ret == -1){
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        written += (size_t)ret;
+    }
+    return 1;
+}
+
+//scrive i primi image_size byte della regione persistente nel file path e li porta su disco (mutex bloccato)
+//La regione viene copiata a blocchi in un buffer e il checksum è calcolato sui byte copiati: altri thread
+//possono ancora scrivere nei blocchi allocati, e il file deve comunque corrispondere al suo checksum.
+//Nel file la bitmap viene sostituita da image_bitmap.
+static int PersistentHeap_write_file(const char* path, size_t image_size, const unsigned char* image_bitmap){
+    static unsigned char chunk[PERSISTENT_SNAPSHOT_CHUNK]; //protetto dal mutex
+    size_t bitmap_start = offsetof(PersistentHeapHeader, buddy_bitmap);
+    size_t bitmap_end = bitmap_start + BITMAP_SIZE_BYTES;
+
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd == -1){
+        perror("Errore: impossibile aprire il file dello snapshot");
+        return 0;
+    }
+
+    uint64_t hash = PERSISTENT_CHECKSUM_SEED;
+    for (size_t offset = 0; offset < image_size; offset += PERSISTENT_SNAPSHOT_CHUNK){
+        size_t len = image_size - offset < PERSISTENT_SNAPSHOT_CHUNK ? image_size - offset : PERSISTENT_SNAPSHOT_CHUNK;
+        memcpy(chunk, persistent_heap_base + offset, len);
+        if (offset < bitmap_end && offset + len > bitmap_start){
+            size_t from = offset > bitmap_start ? offset : bitmap_start;
+            size_t to = offset + len < bitmap_end ? offset + len : bitmap_end;
+            memcpy(chunk + (from - offset), image_bitmap + (from - bitmap_start), to - from);
+        }
+        hash = PersistentHeap_checksum_update(hash, chunk, len, offset);
+        if (!write_all(fd, chunk, len)){
+            perror("Errore: fallita la scrittura dello snapshot");
+            close(fd);
+            return 0;
+        }
+    }
+
+    //il checksum viene scritto per ultimo nel suo campo dell'intestazione
+    if (pwrite(fd, &hash, sizeof(hash), offsetof(PersistentHeapHeader, checksum)) != sizeof(hash)){
+        perror("Errore: fallita la scrittura del checksum dello snapshot");
+        close(fd);
+        return 0;
+    }
+
+    if (fsync(fd) == -1){
+        perror("Errore: fallita la sincronizzazione dello snapshot");
+        close(fd);
+        return 0;
+    }
+    if (close(fd) == -1){
+        perror("Errore: fallita la chiusura dello snapshot");
+        return 0;
+    }
+    return 1;
+}
+
+//salva l'immagine del heap persistente nel file path
+//i metadati sono protetti dal mutex, ma i dati dei blocchi allocati vengono salvati così come sono
+//durante la copia: per un contenuto coerente il chiamante deve fermare le scritture nel heap
+int my_heap_snapshot(const char* path){
+    if (path == NULL){
+        fprintf(stderr, "Errore: parametri non validi\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    if (persistent_heap_base == NULL){
+        fprintf(stderr, "Errore: il heap persistente non è attivo\n");
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    PersistentHeapHeader* header = PersistentHeap_header();
+
+    //i blocchi nella cache della coalescenza differita risultano liberi solo nella bitmap dell'immagine:
+    //la cache del processo corrente resta com'è
+    static unsigned char image_bitmap[BITMAP_SIZE_BYTES]; //protetta dal mutex
+    memcpy(image_bitmap, buddy_bitmap, BITMAP_SIZE_BYTES);
+    unsigned char* live_bitmap = buddy_bitmap;
+    size_t live_merges = buddy_stats.merges;
+    buddy_bitmap = image_bitmap;
+    for (int level = 0; level <= MAX_LEVEL; ++level){
+        for (size_t i = 0; i < deferred_count[level]; ++i){
+            BuddyAllocator_release(deferred_blocks[level][i], level);
+        }
+    }
+    buddy_bitmap = live_bitmap;
+    buddy_stats.merges = live_merges;
+
+    //l'immagine arriva fino alla fine dell'ultimo blocco grande (la lista è ordinata)
+    char* image_end = PersistentHeap_arena_start();
+    for (LargeAllocInfo* current = header->large_allocs_head; current != NULL; current = current->next){
+        image_end = (char*)current->ptr + round_up_to_page(current->size);
+    }
+    header->image_size = (size_t)(image_end - persistent_heap_base);
+
+    //l'immagine viene scritta in un file temporaneo e poi rinominata: il file precedente potrebbe
+    //essere mappato come heap corrente (dopo un ripristino) e non deve essere troncato
+    char* tmp_path = (char*)malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp_path == NULL){
+        perror("Errore: fallita l'allocazione del percorso temporaneo\n");
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+    strcpy(tmp_path, path);
+    strcat(tmp_path, ".tmp");
+
+    int ok = PersistentHeap_write_file(tmp_path, header->image_size, image_bitmap);
+    if (ok && rename(tmp_path, path) == -1){
+        perror("Errore: fallita la sostituzione del file dello snapshot");
+        ok = 0;
+    }
+    if (!ok){
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+    return ok;
+}
+
+//controlla che l'immagine sia coerente prima di mapparla
+//image è l'immagine mappata in un indirizzo qualsiasi, file_size la dimensione del file
+static int PersistentHeap_validate_image(const unsigned char* image, size_t file_size){
+    if (file_size < sizeof(PersistentHeapHeader)){
+        return 0;
+    }
+
+    const PersistentHeapHeader* header = (const PersistentHeapHeader*)image;
+    size_t header_size = PersistentHeap_header_size();
+    size_t arena_offset = header_size + BUDDY_POOL_SIZE;
+
+    //l'immagine deve essere stata creata con la stessa configurazione
+    if (header->magic != PERSISTENT_HEAP_MAGIC || header->version != PERSISTENT_HEAP_VERSION ||
+        header->bitmap_size != BITMAP_SIZE_BYTES || header->base_addr != (uintptr_t)PERSISTENT_HEAP_BASE ||
+        header->header_size != header_size || header->pool_size != BUDDY_POOL_SIZE ||
+        header->large_arena_size != PERSISTENT_LARGE_ARENA_SIZE ||
+        header->max_large_allocs != PERSISTENT_MAX_LARGE_ALLOCS){
+        return 0;
+    }
+    if (header->image_size != file_size || file_size < arena_offset ||
+        file_size > PersistentHeap_region_size() || file_size % PAGE_SIZE != 0){
+        return 0;
+    }
+    if (header->checksum != PersistentHeap_checksum(image, file_size)){
+        return 0;
+    }
+
+    //bitmap: un blocco occupato (o diviso) deve avere il genitore diviso
+    for (int idx = 1; idx < TOTAL_NODES; ++idx){
+        int is_set = (header->buddy_bitmap[idx / 8] >> (idx % 8)) & 1;
+        int parent = PARENT(idx);
+        if (is_set && !((header->buddy_bitmap[parent / 8] >> (parent % 8)) & 1)){
+            return 0;
+        }
+    }
+
+    //lista delle allocazioni grandi: nodi validi, blocchi ordinati, senza sovrapposizioni e dentro l'immagine
+    uintptr_t base = (uintptr_t)PERSISTENT_HEAP_BASE;
+    uintptr_t nodes_start = base + offsetof(PersistentHeapHeader, large_nodes);
+    uintptr_t nodes_end = nodes_start + sizeof(header->large_nodes);
+    size_t prev_end = arena_offset;
+    size_t count = 0;
+    for (uintptr_t node_addr = (uintptr_t)header->large_allocs_head; node_addr != 0; ){
+        if (node_addr < nodes_start || node_addr >= nodes_end ||
+            (node_addr - nodes_start) % sizeof(LargeAllocInfo) != 0 || ++count > PERSISTENT_MAX_LARGE_ALLOCS){
+            return 0;
+        }
+        const LargeAllocInfo* node = (const LargeAllocInfo*)(image + (node_addr - base));
+        uintptr_t ptr = (uintptr_t)node->ptr;
+        if (ptr < base + prev_end || node->size == 0 || node->size > file_size ||
+            ptr - base + round_up_to_page(node->size) > file_size){
+            return 0;
+        }
+        prev_end = ptr - base + round_up_to_page(node->size);
+        node_addr = (uintptr_t)node->next;
+    }
+
+    //ogni nodo in uso deve essere nella lista, altrimenti non verrebbe mai riusato
+    size_t used_nodes = 0;
+    for (size_t i = 0; i < PERSISTENT_MAX_LARGE_ALLOCS; ++i){
+        if (header->large_nodes[i].ptr != NULL){
+            used_nodes++;
+        }
+    }
+    return used_nodes == count;
+}
+
+//ripristina il heap persistente dall'immagine salvata in path
+//lo stato corrente del heap persistente viene sostituito; un'immagine non coerente viene rifiutata
+//senza modificare il heap corrente
+int my_heap_restore(const char* path){
+    if (path == NULL){
+        fprintf(stderr, "Errore: parametri non validi\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&my_malloc_mutex);
+
+    if (PAGE_SIZE == 0){
+        init_page_size();
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1){
+        perror("Errore: impossibile aprire il file dello snapshot");
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0){
+        fprintf(stderr, "Errore: snapshot vuoto o non leggibile\n");
+        close(fd);
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+    size_t file_size = (size_t)st.st_size;
+
+    //l'immagine viene mappata e controllata in un indirizzo temporaneo, prima di toccare il heap corrente
+    //(il checksum copre tutta l'immagine, quindi ogni ripristino legge e controlla tutte le pagine del file)
+    void* image = mmap(NULL, file_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED){
+        perror("Errore: fallita la mappatura dello snapshot");
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+    if (!PersistentHeap_validate_image((const unsigned char*)image, file_size)){
+        fprintf(stderr, "Errore: snapshot non coerente, ripristino rifiutato\n");
+        munmap(image, file_size);
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    int new_region = (persistent_heap_base == NULL);
+    if (new_region && !PersistentHeap_create_region()){
+        munmap(image, file_size);
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    //sposta l'immagine all'indirizzo fisso, sostituendo in un solo passo l'inizio della regione
+    if (mremap(image, file_size, file_size, MREMAP_MAYMOVE|MREMAP_FIXED, PERSISTENT_HEAP_BASE) == MAP_FAILED){
+        perror("Errore: fallito lo spostamento dello snapshot nella regione persistente");
+        munmap(image, file_size);
+        if (new_region){
+            //torna al pool normale, la regione appena creata non è utilizzabile
+            munmap(PERSISTENT_HEAP_BASE, PersistentHeap_region_size());
+            BuddyAllocator_init();
+        }
+        pthread_mutex_unlock(&my_malloc_mutex);
+        return 0;
+    }
+
+    //azzera la parte della regione oltre l'immagine, che conterrebbe ancora dati del heap sostituito
+    //(è solo spazio libero dell'area delle allocazioni grandi, quindi un errore qui non è grave)
+    if (!new_region && madvise(PERSISTENT_HEAP_BASE + file_size, PersistentHeap_region_size() - file_size, MADV_DONTNEED) == -1){
+        perror("Errore: fallito l'azzeramento della regione persistente");
+    }
+
+    //la cache della coalescenza differita si riferiva al heap sostituito
+    memset(deferred_count, 0, sizeof(deferred_count));
+
+    PersistentHeap_attach();
+
+    pthread_mutex_unlock(&my_malloc_mutex);
+    return 1;
+}
@@ -0,0 +1,289 @@
+#include "my_malloc.h"
+
+#include <stdio.h> //per printf()
+#include <stdlib.h> // per rand, EXIT_SUCCESS
+#include <time.h> // per clock_gettime
+#include <string.h> // per memset
+#include <unistd.h> // per fork e pipe
+#include <sys/wait.h> // per waitpid
+#include <sys/resource.h> // per getrusage
+
+#define NUM_OPS 200000 //operazioni malloc/free per ogni carico
+#define WINDOW_SIZE 256 //allocazioni vive nel carico a finestra
+#define BATCH_SIZE 512 //allocazioni per lotto nel carico a lotti
+#define LAZY_WATERMARK 64 //soglia per livello usata in modalità differita
+#define NUM_LEVEL_CALLS 10000000 //chiamate nel microbenchmark del calcolo del livello
+#define NUM_STARTUP_TRIALS 200 //processi avviati per misurare la latenza della prima richiesta
+#define REQUEST_NODES 2000 //nodi allocati da una richiesta
+#define REQUEST_BUFFERS 50 //buffer da 200 byte allocati da una richiesta
+
+struct node{
+    int value;
+    struct node* next;
+};
+
+//risultato di una misura della prima richiesta, inviato dal processo figlio al padre
+typedef struct StartupSample{
+    double latency_ns;
+    long minor_faults;
+} StartupSample;
+
+static void* window[WINDOW_SIZE];
+static struct node* request_nodes[REQUEST_NODES];
+static char* request_buffers[REQUEST_BUFFERS];
+static void* batch[BATCH_SIZE];
+
+//tempo corrente in nanosecondi
+static double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//cicli di clock (rdtsc) su x86, altrimenti nanosecondi
+static unsigned long long now_cycles(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return (unsigned long long)now_ns();
+#endif
+}
+
+//calcolo del livello con i due cicli usati prima di __builtin_clzl (solo come riferimento)
+static int level_with_loops(size_t size){
+    if (size < 64){
+        size = 64;
+    }
+    size_t actual_size = 1;
+    while(actual_size < size){
+        actual_size <<= 1;
+    }
+    if (actual_size > (1 << MY_MALLOC_POOL_LOG2)){
+        actual_size = 1 << MY_MALLOC_POOL_LOG2;
+    }
+    int level = 0;
+    size_t temp_size = 1 << MY_MALLOC_POOL_LOG2;
+    while (temp_size > actual_size && level < MY_MALLOC_POOL_LOG2 - MY_MALLOC_MIN_BLOCK_LOG2){
+        temp_size >>= 1;
+        level++;
+    }
+    return level;
+}
+
+//microbenchmark: cicli per calcolare il livello con i cicli e con __builtin_clzl
+static void bench_level_computation(){
+    volatile size_t size = sizeof(struct node) + sizeof(size_t); //volatile: il calcolo avviene a runtime
+    volatile int sink = 0;
+
+    unsigned long long start = now_cycles();
+    for (int i = 0; i < NUM_LEVEL_CALLS; ++i){
+        sink = level_with_loops(size);
+    }
+    unsigned long long loops = now_cycles() - start;
+
+    start = now_cycles();
+    for (int i = 0; i < NUM_LEVEL_CALLS; ++i){
+        sink = MY_MALLOC_LEVEL_FROM_SIZE(size);
+    }
+    unsigned long long clz = now_cycles() - start;
+    (void)sink;
+
+    printf("livello    cicli:    %6.1f cicli/chiamata\n", (double)loops / NUM_LEVEL_CALLS);
+    printf("livello    clzl:     %6.1f cicli/chiamata\n", (double)clz / NUM_LEVEL_CALLS);
+}
+
+//microbenchmark: my_malloc di dimensione costante (livello calcolato a tempo di compilazione)
+//e di dimensione nota solo a runtime, con i blocchi riusati dalla cache per isolare il calcolo del livello
+static void bench_constant_size(){
+    volatile size_t runtime_size = sizeof(struct node);
+    my_malloc_set_lazy_coalescing(LAZY_WATERMARK);
+
+    unsigned long long start = now_cycles();
+    for (int i = 0; i < NUM_OPS; ++i){
+        my_free(my_malloc(sizeof(struct node)));
+    }
+    unsigned long long constant = now_cycles() - start;
+
+    start = now_cycles();
+    for (int i = 0; i < NUM_OPS; ++i){
+        my_free(my_malloc(runtime_size));
+    }
+    unsigned long long runtime = now_cycles() - start;
+
+    my_malloc_set_lazy_coalescing(0);
+    printf("malloc     costante: %6.1f cicli/coppia malloc+free\n", (double)constant / NUM_OPS);
+    printf("malloc     runtime:  %6.1f cicli/coppia malloc+free\n", (double)runtime / NUM_OPS);
+}
+
+//una richiesta tipica: nodi e buffer piccoli scritti e poi liberati
+static void first_request(){
+    for (int i = 0; i < REQUEST_NODES; ++i){
+        request_nodes[i] = my_malloc(sizeof(struct node));
+        request_nodes[i]->value = i;
+        request_nodes[i]->next = NULL;
+    }
+    for (int i = 0; i < REQUEST_BUFFERS; ++i){
+        request_buffers[i] = my_malloc(200);
+        memset(request_buffers[i], i, 200);
+    }
+    for (int i = 0; i < REQUEST_NODES; ++i){
+        my_free(request_nodes[i]);
+    }
+    for (int i = 0; i < REQUEST_BUFFERS; ++i){
+        my_free(request_buffers[i]);
+    }
+}
+
+//misura la prima richiesta in un processo nuovo (l'allocatore non deve essere ancora inizializzato)
+static StartupSample measure_first_request(int warm_up){
+    if (warm_up){
+        size_t hints[MY_MALLOC_NUM_LEVELS] = {0};
+        hints[MY_MALLOC_LEVEL_FROM_SIZE(200 + sizeof(size_t))] = REQUEST_BUFFERS;
+        my_malloc_set_prefault(1);
+        my_malloc_set_lazy_coalescing(REQUEST_BUFFERS); //i blocchi riservati restano nella cache
+        my_malloc_reserve(REQUEST_NODES * 64 + REQUEST_BUFFERS * 256, hints);
+    } else {
+        my_free(my_malloc(1)); //inizializza il pool senza popolarlo
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    double start = now_ns();
+    first_request();
+    double elapsed = now_ns() - start;
+    getrusage(RUSAGE_SELF, &after);
+
+    StartupSample sample = {elapsed, after.ru_minflt - before.ru_minflt};
+    return sample;
+}
+
+static int compare_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+//latenza della prima richiesta con e senza pre-faulting, ogni misura in un processo figlio
+static void bench_first_request(int warm_up){
+    static double latencies[NUM_STARTUP_TRIALS];
+    long total_faults = 0;
+    int samples = 0;
+
+    for (int trial = 0; trial < NUM_STARTUP_TRIALS; ++trial){
+        int fds[2];
+        if (pipe(fds) == -1){
+            perror("pipe");
+            return;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == -1){
+            perror("fork");
+            close(fds[0]);
+            close(fds[1]);
+            return;
+        }
+        if (pid == 0){
+            //il figlio non stampa su stdout, invia solo la misura
+            freopen("/dev/null", "w", stdout);
+            close(fds[0]);
+            StartupSample sample = measure_first_request(warm_up);
+            _exit(write(fds[1], &sample, sizeof(sample)) == sizeof(sample) ? 0 : 1);
+        }
+        close(fds[1]);
+        StartupSample sample;
+        if (read(fds[0], &sample, sizeof(sample)) == sizeof(sample)){
+            latencies[samples++] = sample.latency_ns;
+            total_faults += sample.minor_faults;
+        }
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+    }
+    if (samples == 0){
+        return;
+    }
+
+    qsort(latencies, samples, sizeof(double), compare_double);
+    printf("prima richiesta %-14s p50: %8.1f us  p99: %8.1f us  page fault medi: %6.1f\n",
+           warm_up ? "con warm-up" : "senza warm-up", latencies[samples / 2] / 1000,
+           latencies[(samples * 99) / 100] / 1000, (double)total_faults / samples);
+}
+
+//carico 1: malloc/free alternati della stessa dimensione
+static size_t workload_ping_pong(){
+    for (int i = 0; i < NUM_OPS; ++i){
+        void* p = my_malloc(48);
+        my_free(p);
+    }
+    return 2 * (size_t)NUM_OPS;
+}
+
+//carico 2: finestra di allocazioni vive di dimensione casuale, sostituite in ordine casuale
+static size_t workload_window(){
+    srand(42);
+    for (int i = 0; i < WINDOW_SIZE; ++i){
+        window[i] = my_malloc((rand() % 500) + 1);
+    }
+    for (int i = 0; i < NUM_OPS; ++i){
+        int slot = rand() % WINDOW_SIZE;
+        my_free(window[slot]);
+        window[slot] = my_malloc((rand() % 500) + 1);
+    }
+    for (int i = 0; i < WINDOW_SIZE; ++i){
+        my_free(window[i]);
+    }
+    return 2 * (size_t)(NUM_OPS + WINDOW_SIZE);
+}
+
+//carico 3: lotti di allocazioni della stessa dimensione liberati tutti insieme
+static size_t workload_batch(){
+    size_t ops = 0;
+    for (int round = 0; round < NUM_OPS / BATCH_SIZE; ++round){
+        for (int i = 0; i < BATCH_SIZE; ++i){
+            batch[i] = my_malloc(100);
+        }
+        for (int i = 0; i < BATCH_SIZE; ++i){
+            my_free(batch[i]);
+        }
+        ops += 2 * BATCH_SIZE;
+    }
+    return ops;
+}
+
+//esegue un carico con la soglia indicata e stampa contatori e tempo per operazione
+static void run(const char* name, size_t (*workload)(), size_t watermark){
+    my_malloc_set_lazy_coalescing(watermark);
+    my_malloc_reset_stats();
+
+    double start = now_ns();
+    size_t ops = workload();
+    double elapsed = now_ns() - start;
+
+    MyMallocStats stats;
+    my_malloc_get_stats(&stats);
+    printf("%-10s %-8s divisioni: %9zu  unioni: %9zu  riusi: %9zu  %8.1f ns/op\n",
+           name, watermark == 0 ? "eager" : "lazy", stats.splits, stats.merges, stats.deferred_hits, elapsed / ops);
+
+    my_malloc_set_lazy_coalescing(0);
+}
+
+int main(){
+    //va eseguito per primo: i processi figli devono partire con l'allocatore non inizializzato
+    printf("---Benchmark latenza della prima richiesta---\n");
+    bench_first_request(0);
+    bench_first_request(1);
+
+    printf("---Benchmark coalescenza immediata (eager) e differita (lazy)---\n");
+
+    run("ping-pong", workload_ping_pong, 0);
+    run("ping-pong", workload_ping_pong, LAZY_WATERMARK);
+    run("finestra", workload_window, 0);
+    run("finestra", workload_window, LAZY_WATERMARK);
+    run("lotti", workload_batch, 0);
+    run("lotti", workload_batch, LAZY_WATERMARK);
+
+    printf("---Microbenchmark calcolo del livello buddy---\n");
+    bench_level_computation();
+    bench_constant_size();
+
+    return EXIT_SUCCESS;
+}
@@ -4,6 +4,8 @@
 #include <stdlib.h> // per EXIT_SUCCESS, EXIT_FAILURE
 #include <string.h> // per memset
 #include <time.h> // per time (srand)
+#include <unistd.h> // per getpid, fork e unlink
+#include <sys/wait.h> // per waitpid
 
 #define NUM_RANDOM_ALLOCS 2000 //numero di allocazioni e deallocazioni casuali
 #define MAX_RANDOM_SIZE (16*1024) // dimensione massima delle richieste di memoria per allocazioni casuali (16KB)
@@ -13,11 +15,35 @@
 #endif
 #define MALLOC_THRESHOLD_FOR_TESTS (PAGE_SIZE_FOR_TESTS / 4) //1024 bytes
 
+#define NUM_SNAPSHOT_NODES 100 //nodi della lista usata nel test dello snapshot
+#define CHILD_NODE_OFFSET 1024 //posizione nel buffer grande del puntatore al nodo allocato dal processo figlio
+
+#define NUM_PING_PONG 1000 //coppie malloc/free della stessa dimensione nel test della coalescenza differita
+#define MIN_BLOCKS_IN_POOL (1024*1024 / 64) //blocchi minimi nel buddy pool
+#define KB_BLOCKS_IN_POOL (1024*1024 / 1024) //blocchi da 1KB nel buddy pool
+#define NUM_RESERVED_NODES 32 //nodi divisi in anticipo nel test di my_malloc_reserve
+
+static void* min_blocks[MIN_BLOCKS_IN_POOL];
+static void* kb_blocks[KB_BLOCKS_IN_POOL];
+static void* small_blocks[MIN_BLOCKS_IN_POOL];
+
+//nodo di una lista allocata con my_malloc, usato per verificare che i puntatori restino validi
+struct node{
+    int value;
+    struct node* next;
+};
+
 int main(){
     printf("---Test iniziale del pseudo malloc---\n");
 
     srand(time(NULL)); //inizializzazione generatore numeri casuali per le dimensioni
 
+    //un ripristino fallito come prima chiamata non deve lasciare l'allocatore senza pool
+    if (my_heap_restore("/nonexistent/my_malloc_snapshot.img")){
+        fprintf(stderr, "ripristino di uno snapshot inesistente riuscito\n");
+        return EXIT_FAILURE;
+    }
+
     printf("Test 1: allocazione e deallocazione singola (Buddy e mmap): \n");
     void *p1_small = my_malloc(100); // Dovrebbe usare il Buddy Allocator (es. 128 byte)
     void *p2_large = my_malloc(20000); // Dovrebbe usare mmap (20 KB)
@@ -146,4 +172,314 @@ int main(){
     printf("my_free(NULL) chiamata\n");
     my_free((void*)0x12345678); //liberazione di un puntatore non allocato
     printf("my_free(0x12345678) chiamata (dovrebbe generare un errore su stderr)\n");
-}
\ No newline at end of file
+
+    printf("Test 5: snapshot e ripristino del heap persistente\n");
+    if (!my_heap_persistent_init()){
+        fprintf(stderr, "   attivazione del heap persistente fallita\n");
+        return EXIT_FAILURE;
+    }
+
+    //costruisce una lista di nodi piccoli (buddy) e un buffer grande (area delle allocazioni grandi)
+    struct node* list_head = NULL;
+    for (int i = 0; i < NUM_SNAPSHOT_NODES; ++i){
+        struct node* n = my_malloc(sizeof(struct node));
+        if (n == NULL){
+            fprintf(stderr, "   allocazione del nodo %d fallita\n", i);
+            return EXIT_FAILURE;
+        }
+        n->value = i;
+        n->next = list_head;
+        list_head = n;
+    }
+    char* big_buffer = my_malloc(20000);
+    if (big_buffer == NULL){
+        fprintf(stderr, "   allocazione grande persistente fallita\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(big_buffer, string_test);
+
+    char snapshot_path[64];
+    snprintf(snapshot_path, sizeof(snapshot_path), "/tmp/my_malloc_snapshot_%d.img", (int)getpid());
+    if (!my_heap_snapshot(snapshot_path)){
+        fprintf(stderr, "   snapshot fallito\n");
+        return EXIT_FAILURE;
+    }
+
+    //modifica il heap dopo lo snapshot: il ripristino deve annullare queste modifiche
+    my_free(big_buffer);
+    for (struct node* n = list_head; n != NULL; n = n->next){
+        n->value = -1;
+    }
+
+    if (!my_heap_restore(snapshot_path)){
+        fprintf(stderr, "   ripristino fallito\n");
+        return EXIT_FAILURE;
+    }
+    int expected = NUM_SNAPSHOT_NODES - 1;
+    for (struct node* n = list_head; n != NULL; n = n->next){
+        if (n->value != expected){
+            fprintf(stderr, "   nodo non valido dopo il ripristino: %d (atteso %d)\n", n->value, expected);
+            return EXIT_FAILURE;
+        }
+        expected--;
+    }
+    if (expected != -1 || strcmp(big_buffer, string_test) != 0){
+        fprintf(stderr, "   contenuto del heap non valido dopo il ripristino\n");
+        return EXIT_FAILURE;
+    }
+    printf("   lista e buffer grande ripristinati correttamente\n");
+
+    //riavvio: un processo figlio ripristina l'immagine, percorre la lista con i puntatori salvati,
+    //alloca un nodo e salva di nuovo lo snapshot nello stesso file (che è mappato come heap corrente)
+    const char* child_marker = "Scritto dal processo figlio";
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1){
+        perror("   fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0){
+        if (!my_heap_restore(snapshot_path)) _exit(1);
+        int child_expected = NUM_SNAPSHOT_NODES - 1;
+        for (struct node* n = list_head; n != NULL; n = n->next){
+            if (n->value != child_expected--) _exit(2);
+        }
+        struct node* child_node = my_malloc(sizeof(struct node));
+        if (child_expected != -1 || child_node == NULL) _exit(3);
+        child_node->value = NUM_SNAPSHOT_NODES;
+        child_node->next = NULL;
+        strcpy(big_buffer, child_marker);
+        memcpy(big_buffer + CHILD_NODE_OFFSET, &child_node, sizeof(child_node));
+        if (!my_heap_snapshot(snapshot_path)) _exit(4);
+        _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "   processo figlio fallito (stato %d)\n", status);
+        return EXIT_FAILURE;
+    }
+
+    //il padre ripristina lo snapshot scritto dal figlio
+    if (!my_heap_restore(snapshot_path)){
+        fprintf(stderr, "   ripristino dello snapshot del figlio fallito\n");
+        return EXIT_FAILURE;
+    }
+    struct node* child_node;
+    memcpy(&child_node, big_buffer + CHILD_NODE_OFFSET, sizeof(child_node));
+    if (strcmp(big_buffer, child_marker) != 0 || child_node->value != NUM_SNAPSHOT_NODES ||
+        list_head->value != NUM_SNAPSHOT_NODES - 1){
+        fprintf(stderr, "   snapshot del figlio non valido\n");
+        return EXIT_FAILURE;
+    }
+    my_free(child_node);
+    printf("   ripristino e nuovo snapshot nel processo figlio riusciti\n");
+
+    //un'immagine corrotta deve essere rifiutata senza toccare il heap corrente
+    FILE* f = fopen(snapshot_path, "r+b");
+    if (f == NULL || fseek(f, PAGE_SIZE_FOR_TESTS * 8, SEEK_SET) != 0 || fputc(0x5a, f) == EOF){
+        fprintf(stderr, "   impossibile corrompere lo snapshot\n");
+        return EXIT_FAILURE;
+    }
+    fclose(f);
+    if (my_heap_restore(snapshot_path)){
+        fprintf(stderr, "   snapshot corrotto accettato\n");
+        return EXIT_FAILURE;
+    }
+    if (list_head->value != NUM_SNAPSHOT_NODES - 1 || strcmp(big_buffer, child_marker) != 0){
+        fprintf(stderr, "   heap modificato da un ripristino rifiutato\n");
+        return EXIT_FAILURE;
+    }
+    printf("   snapshot corrotto rifiutato (atteso un errore su stderr)\n");
+    unlink(snapshot_path);
+
+    while (list_head != NULL){
+        struct node* next = list_head->next;
+        my_free(list_head);
+        list_head = next;
+    }
+    my_free(big_buffer);
+    printf("   Test snapshot completato.\n\n");
+
+    printf("Test 6: coalescenza differita\n");
+    if (!my_malloc_set_lazy_coalescing(8)){
+        fprintf(stderr, "   attivazione della coalescenza differita fallita\n");
+        return EXIT_FAILURE;
+    }
+
+    //ping-pong alla stessa dimensione: dopo la prima allocazione non ci devono essere divisioni né unioni
+    MyMallocStats stats;
+    my_malloc_reset_stats();
+    void* first = my_malloc(48);
+    my_free(first);
+    my_malloc_get_stats(&stats);
+    size_t first_splits = stats.splits;
+    for (int i = 1; i < NUM_PING_PONG; ++i){
+        void* p = my_malloc(48);
+        if (p != first){
+            fprintf(stderr, "   il blocco in cache non è stato riusato\n");
+            return EXIT_FAILURE;
+        }
+        my_free(p);
+    }
+    my_malloc_get_stats(&stats);
+    printf("   divisioni: %zu, unioni: %zu, riusi dalla cache: %zu\n", stats.splits, stats.merges, stats.deferred_hits);
+    if (stats.splits != first_splits || stats.merges != 0 || stats.deferred_hits != NUM_PING_PONG - 1){
+        fprintf(stderr, "   contatori inattesi con la coalescenza differita\n");
+        return EXIT_FAILURE;
+    }
+
+    //lo snapshot non svuota la cache del processo, ma nell'immagine il blocco in cache è libero
+    //(dopo il ripristino il riempimento successivo deve trovare tutto il pool libero)
+    if (!my_heap_snapshot(snapshot_path) || my_malloc(48) != first){
+        fprintf(stderr, "   la cache è stata svuotata dallo snapshot\n");
+        return EXIT_FAILURE;
+    }
+    my_free(first);
+    if (!my_heap_restore(snapshot_path)){
+        fprintf(stderr, "   ripristino con coalescenza differita fallito\n");
+        return EXIT_FAILURE;
+    }
+    unlink(snapshot_path);
+
+    //riempie il pool di blocchi minimi e li libera: quelli in cache devono essere uniti
+    //quando servono blocchi più grandi
+    int min_count = 0;
+    while (min_count < MIN_BLOCKS_IN_POOL && (min_blocks[min_count] = my_malloc(48)) != NULL){
+        min_count++;
+    }
+    for (int i = 0; i < min_count; ++i){
+        my_free(min_blocks[i]);
+    }
+    int kb_count = 0;
+    while (kb_count < KB_BLOCKS_IN_POOL && (kb_blocks[kb_count] = my_malloc(1000)) != NULL){
+        kb_count++;
+    }
+    printf("   blocchi minimi: %d, blocchi da 1KB dopo il rilascio: %d\n", min_count, kb_count);
+    if (min_count != MIN_BLOCKS_IN_POOL || kb_count != KB_BLOCKS_IN_POOL){
+        fprintf(stderr, "   la cache non è stata svuotata quando il pool era esaurito\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < kb_count; ++i){
+        my_free(kb_blocks[i]);
+    }
+
+    //riempie la cache con blocchi da 128 byte e poi il pool con blocchi più piccoli:
+    //i blocchi piccoli non devono finire dentro quelli in cache
+    my_malloc_set_lazy_coalescing(64);
+    int cached_count = 0;
+    while (cached_count < MIN_BLOCKS_IN_POOL && (min_blocks[cached_count] = my_malloc(100)) != NULL){
+        cached_count++;
+    }
+    for (int i = 0; i < cached_count; ++i){
+        my_free(min_blocks[i]);
+    }
+    int small_count = 0;
+    while (small_count < MIN_BLOCKS_IN_POOL && (small_blocks[small_count] = my_malloc(40)) != NULL){
+        *(int*)small_blocks[small_count] = small_count;
+        small_count++;
+    }
+    void* overlapping = my_malloc(100);
+    printf("   blocchi da 128 byte: %d, blocchi piccoli dopo il rilascio: %d\n", cached_count, small_count);
+    if (cached_count != MIN_BLOCKS_IN_POOL / 2 || small_count != MIN_BLOCKS_IN_POOL || overlapping != NULL){
+        fprintf(stderr, "   blocco in cache sovrapposto a blocchi allocati\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < small_count; ++i){
+        if (*(int*)small_blocks[i] != i){
+            fprintf(stderr, "   blocco piccolo %d sovrascritto\n", i);
+            return EXIT_FAILURE;
+        }
+        my_free(small_blocks[i]);
+    }
+
+    my_malloc_set_lazy_coalescing(0);
+    printf("   Test coalescenza differita completato.\n\n");
+
+    printf("Test 7: pre-faulting e my_malloc_reserve\n");
+    my_malloc_set_prefault(1);
+
+    //con la coalescenza immediata non si possono riservare blocchi
+    size_t hints[MY_MALLOC_NUM_LEVELS] = {0};
+    hints[MY_MALLOC_LEVEL_FROM_SIZE(sizeof(struct node) + sizeof(size_t))] = 1;
+    if (my_malloc_reserve(0, hints)){
+        fprintf(stderr, "   my_malloc_reserve riuscita senza coalescenza differita\n");
+        return EXIT_FAILURE;
+    }
+
+    //divide in anticipo i blocchi per i nodi: le malloc successive non devono dividere
+    my_malloc_set_lazy_coalescing(NUM_RESERVED_NODES);
+
+    //i livelli con blocchi da 4KB o più non sono mai usati da my_malloc
+    size_t large_hints[MY_MALLOC_NUM_LEVELS] = {0};
+    large_hints[MY_MALLOC_LEVEL_FROM_SIZE(PAGE_SIZE_FOR_TESTS)] = 1;
+    if (my_malloc_reserve(0, large_hints)){
+        fprintf(stderr, "   my_malloc_reserve riuscita per un livello non usato da my_malloc\n");
+        return EXIT_FAILURE;
+    }
+
+    hints[MY_MALLOC_LEVEL_FROM_SIZE(sizeof(struct node) + sizeof(size_t))] = NUM_RESERVED_NODES;
+    if (!my_malloc_reserve(64 * 1024, hints)){
+        fprintf(stderr, "   my_malloc_reserve fallita\n");
+        return EXIT_FAILURE;
+    }
+    my_malloc_reset_stats();
+    struct node* reserved[NUM_RESERVED_NODES];
+    for (int i = 0; i < NUM_RESERVED_NODES; ++i){
+        reserved[i] = my_malloc(sizeof(struct node));
+        if (reserved[i] == NULL){
+            fprintf(stderr, "   allocazione del nodo riservato %d fallita\n", i);
+            return EXIT_FAILURE;
+        }
+        reserved[i]->value = i;
+    }
+    my_malloc_get_stats(&stats);
+    printf("   divisioni: %zu, riusi dalla cache: %zu\n", stats.splits, stats.deferred_hits);
+    if (stats.splits != 0 || stats.deferred_hits != NUM_RESERVED_NODES){
+        fprintf(stderr, "   i blocchi riservati non sono stati usati\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < NUM_RESERVED_NODES; ++i){
+        my_free(reserved[i]);
+    }
+
+    //riserva blocchi da 256 byte e riempie il pool con blocchi più piccoli:
+    //i blocchi piccoli non devono finire dentro quelli riservati
+    memset(hints, 0, sizeof(hints));
+    hints[MY_MALLOC_LEVEL_FROM_SIZE(200 + sizeof(size_t))] = NUM_RESERVED_NODES;
+    if (!my_malloc_reserve(0, hints)){
+        fprintf(stderr, "   my_malloc_reserve dei blocchi da 256 byte fallita\n");
+        return EXIT_FAILURE;
+    }
+    int filled_count = 0;
+    while (filled_count < MIN_BLOCKS_IN_POOL && (small_blocks[filled_count] = my_malloc(40)) != NULL){
+        *(int*)small_blocks[filled_count] = filled_count;
+        filled_count++;
+    }
+    void* overlapping_reserved = my_malloc(200);
+    printf("   blocchi piccoli dopo my_malloc_reserve: %d\n", filled_count);
+    if (filled_count != MIN_BLOCKS_IN_POOL || overlapping_reserved != NULL){
+        fprintf(stderr, "   blocco riservato sovrapposto a blocchi allocati\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < filled_count; ++i){
+        if (*(int*)small_blocks[i] != i){
+            fprintf(stderr, "   blocco piccolo %d sovrascritto\n", i);
+            return EXIT_FAILURE;
+        }
+        my_free(small_blocks[i]);
+    }
+    my_malloc_set_lazy_coalescing(0);
+
+    //allocazione grande con pre-faulting attivo
+    char* prefaulted = my_malloc(20000);
+    if (prefaulted == NULL){
+        fprintf(stderr, "   allocazione grande con pre-faulting fallita\n");
+        return EXIT_FAILURE;
+    }
+    memset(prefaulted, 1, 20000);
+    my_free(prefaulted);
+
+    my_malloc_set_prefault(0);
+    printf("   Test pre-faulting completato.\n");
+    return EXIT_SUCCESS;
+}